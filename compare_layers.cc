@@ -0,0 +1,138 @@
+#include "keras_model.h"
+
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <math.h>
+
+using namespace std;
+using namespace keras;
+
+// Compare two layer dumps (see KerasModel::set_layer_dump) layer by layer,
+// e.g. the reference build against an optimized or quantized one.
+// To compile:
+// g++ -std=c++11 compare_layers.cc keras_model.cc -o compare_layers
+
+
+// map float bits onto a monotonic integer scale, neighbouring floats differ by 1
+static int64_t ordered_bits(float f) {
+  int32_t i;
+  memcpy(&i, &f, sizeof(f));
+  return (i < 0) ? (int64_t)INT32_MIN - i : i;
+}
+
+// layers which a tiled build may compute as one chain, see Layer::get_output_rows
+static bool is_tileable(string const & name) {
+  return name == "Conv2D" || name == "DepthwiseConv2D" || name == "SeparableConv2D" ||
+         name == "Activation" || name == "MaxPooling2D";
+}
+
+static uint64_t ulp_distance(float a, float b) {
+  if(isnan(a) || isnan(b)) return (isnan(a) && isnan(b)) ? 0 : UINT32_MAX;
+  int64_t d = ordered_bits(a) - ordered_bits(b);
+  return (d < 0) ? -d : d;
+}
+
+
+int main(int argc, char *argv[]) {
+
+  if(argc != 3 && argc != 4) {
+    cout << "Wrong input, going to exit." << endl;
+    cout << "There should be arguments: reference_dump tested_dump [max_ulp]." << endl;
+    return -1;
+  }
+  uint64_t max_ulp_allowed = (argc == 4) ? strtoull(argv[3], 0, 10) : 0;
+
+  vector<LayerOutput> ref, tst;
+  try {
+    ref = read_layer_outputs(argv[1]);
+    tst = read_layer_outputs(argv[2]);
+  } catch(exception const & e) {
+    cout << e.what() << endl;
+    return -1;
+  }
+
+  // layers are matched by index, a tiled build dumps only the last layer
+  // of every tiled chain, so the reference should be an untiled dump
+  map<int, size_t> tst_index;
+  for(size_t i = 0; i < tst.size(); ++i) tst_index[tst[i].m_layer] = i;
+
+  bool failed = false;
+  size_t compared = 0;
+  cout << left << setw(6) << "layer" << setw(16) << "name" << setw(10) << "size"
+       << setw(14) << "max_abs" << setw(14) << "max_rel"
+       << setw(10) << "max_ulp" << setw(12) << "mean_ulp" << endl;
+  map<int, bool> in_ref;
+  for(size_t l = 0; l < ref.size(); ++l) in_ref[ref[l].m_layer] = true;
+
+  // tested dump may lack only inner layers of a tiled chain: tileable layers
+  // followed by a tileable layer which is dumped
+  bool incomplete = false;
+  for(size_t l = 0; l < ref.size(); ++l) {
+    if(tst_index.count(ref[l].m_layer)) continue;
+    size_t next = l + 1;
+    while(next < ref.size() && !tst_index.count(ref[next].m_layer)) ++next;
+    bool in_chain = (next < ref.size()) && is_tileable(ref[next].m_name);
+    for(size_t i = l; i < next; ++i) in_chain = in_chain && is_tileable(ref[i].m_name);
+    if(!in_chain) {
+      cout << "Layer " << ref[l].m_layer << " " << ref[l].m_name << " is missing in tested dump." << endl;
+      incomplete = true;
+    }
+  }
+  for(size_t i = 0; i < tst.size(); ++i) {
+    if(!in_ref.count(tst[i].m_layer)) {
+      cout << "Layer " << tst[i].m_layer << " " << tst[i].m_name << " is missing in reference dump." << endl;
+      incomplete = true;
+    }
+  }
+
+  for(size_t l = 0; l < ref.size(); ++l) {
+    LayerOutput const & r = ref[l];
+    if(tst_index.find(r.m_layer) == tst_index.end()) continue;
+    LayerOutput const & t = tst[tst_index[r.m_layer]];
+    ++compared;
+    if(r.m_name != t.m_name || r.m_shape != t.m_shape) {
+      cout << setw(6) << r.m_layer << setw(16) << r.m_name
+           << "different layer name or shape: " << t.m_name << endl;
+      failed = true;
+      continue;
+    }
+
+    double max_abs = 0, max_rel = 0, sum_ulp = 0;
+    uint64_t max_ulp = 0;
+    for(size_t i = 0; i < r.m_values.size(); ++i) {
+      float a = r.m_values[i], b = t.m_values[i];
+      double abs_err = fabs((double)a - (double)b);
+      double scale = fmax(fabs(a), fabs(b));
+      uint64_t ulp = ulp_distance(a, b);
+      if(abs_err > max_abs) max_abs = abs_err;
+      if(scale > 0 && abs_err / scale > max_rel) max_rel = abs_err / scale;
+      if(ulp > max_ulp) max_ulp = ulp;
+      sum_ulp += ulp;
+    }
+    double mean_ulp = r.m_values.empty() ? 0 : sum_ulp / r.m_values.size();
+    if(max_ulp > max_ulp_allowed) failed = true;
+
+    cout << setw(6) << r.m_layer << setw(16) << r.m_name << setw(10) << r.m_values.size()
+         << setw(14) << max_abs << setw(14) << max_rel
+         << setw(10) << max_ulp << setw(12) << mean_ulp << endl;
+  }
+
+  if(compared != ref.size() || compared != tst.size()) {
+    cout << "Compared " << compared << " common layers, " << ref.size() - compared
+         << " only in reference and " << tst.size() - compared << " only in tested dump." << endl;
+  }
+  if(compared == 0 || incomplete) {
+    cout << "Dumps do not cover the same layers." << endl;
+    return 1;
+  }
+  if(failed) {
+    cout << "Dumps differ by more than " << max_ulp_allowed << " ulp." << endl;
+    return 1;
+  }
+  cout << "Dumps match within " << max_ulp_allowed << " ulp." << endl;
+  return 0;
+}
@@ -1,8 +1,10 @@
 import numpy as np
 np.random.seed(1337)
 from keras.models import Sequential, model_from_json
+from keras import backend as K
 import json
 import argparse
+import sys
 
 np.set_printoptions(threshold=np.inf)
 parser = argparse.ArgumentParser(description='This is a simple script to dump Keras model into simple format suitable for porting into pure C++ model')
@@ -17,6 +19,40 @@ print 'Read architecture from', args.architecture
 print 'Read weights from', args.weights
 print 'Writing to', args.output
 
+def depthwise_for_cpp(W, dim_ordering):
+    # (depth, multiplier, rows, cols), flipped for TensorFlow because
+    # keras2cpp applies kernels as true convolution like Theano
+    if dim_ordering == 'th':
+        W = W.transpose(1, 0, 2, 3)
+    else:
+        W = W.transpose(2, 3, 0, 1)
+    if K.backend() == 'tensorflow':
+        W = W[:, :, ::-1, ::-1]
+    return W
+
+def pointwise_for_cpp(W, dim_ordering):
+    # (nb_filter, depth * multiplier)
+    if dim_ordering == 'th':
+        return W[:, :, 0, 0]
+    return W[0, 0, :, :].T
+
+def check_depthwise_config(l):
+    # keras2cpp depthwise kernels support only stride 1, no dilation and
+    # linear output, anything else would give wrong results silently
+    config = l['config']
+    pair = lambda v: tuple(v) if isinstance(v, (list, tuple)) else (v, v)
+    strides = pair(config.get('strides', config.get('subsample', 1)))
+    dilation = pair(config.get('dilation_rate', 1))
+    activation = config.get('activation', 'linear')
+    if strides != (1, 1) or dilation != (1, 1) or activation != 'linear':
+        sys.exit('Layer ' + config.get('name', l['class_name']) + ': ' + l['class_name'] +
+                 ' with strides ' + str(strides) + ', dilation ' + str(dilation) +
+                 ' and activation ' + str(activation) + ' is not supported, ' +
+                 'only strides (1, 1), dilation (1, 1) and linear activation')
+
+def border_mode(config):
+    return config.get('border_mode', config.get('padding'))
+
 arch = open(args.architecture).read()
 model = model_from_json(arch)
 model.load_weights(args.weights)
@@ -53,6 +89,40 @@ with open(args.output, 'w') as fout:
                         fout.write(str(W[i,j,k]) + '\n')
             fout.write(str(model.layers[ind].get_weights()[1]) + '\n')
 
+        if l['class_name'] == 'DepthwiseConv2D':
+            check_depthwise_config(l)
+            weights = model.layers[ind].get_weights()
+            W = depthwise_for_cpp(weights[0], l['config'].get('dim_ordering', 'tf'))
+            if args.verbose:
+                print W.shape
+            fout.write(str(W.shape[0]) + ' ' + str(W.shape[1]) + ' ' + str(W.shape[2]) + ' ' + str(W.shape[3]) + ' ' + border_mode(l['config']) + '\n')
+
+            for i in range(W.shape[0]):
+                for j in range(W.shape[1]):
+                    for k in range(W.shape[2]):
+                        fout.write(str(W[i,j,k]) + '\n')
+            b = weights[1] if len(weights) > 1 else np.zeros(W.shape[0] * W.shape[1])
+            fout.write(str(b) + '\n')
+
+        if l['class_name'] in ('SeparableConvolution2D', 'SeparableConv2D'):
+            check_depthwise_config(l)
+            weights = model.layers[ind].get_weights()
+            dim_ordering = l['config'].get('dim_ordering', 'tf')
+            W = depthwise_for_cpp(weights[0], dim_ordering)
+            P = pointwise_for_cpp(weights[1], dim_ordering)
+            if args.verbose:
+                print W.shape, P.shape
+            fout.write(str(P.shape[0]) + ' ' + str(W.shape[0]) + ' ' + str(W.shape[1]) + ' ' + str(W.shape[2]) + ' ' + str(W.shape[3]) + ' ' + border_mode(l['config']) + '\n')
+
+            for i in range(W.shape[0]):
+                for j in range(W.shape[1]):
+                    for k in range(W.shape[2]):
+                        fout.write(str(W[i,j,k]) + '\n')
+            for p in P:
+                fout.write(str(p) + '\n')
+            b = weights[2] if len(weights) > 2 else np.zeros(P.shape[0])
+            fout.write(str(b) + '\n')
+
         if l['class_name'] == 'Activation':
             fout.write(l['config']['activation'] + '\n')
         if l['class_name'] == 'MaxPooling2D':
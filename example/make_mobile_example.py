@@ -0,0 +1,133 @@
+from __future__ import print_function
+import random
+
+# Writes a small network with DepthwiseConv2D, 1x1 Convolution2D and
+# SeparableConv2D layers in dumped format (example/mobile.nnet), an input
+# sample (example/sample_mobile.dat) and the expected output computed with a
+# naive reference in double precision (example/mobile_expected.dat).
+# It does not need Keras, run it from the repository root.
+
+random.seed(1337)
+
+DEPTH, ROWS, COLS = 3, 12, 10
+MULTIPLIER = 2
+CLASSES = 10
+
+
+def rand_list(n, scale=1.0):
+    return [float('%.6f' % random.uniform(-scale, scale)) for _ in range(n)]
+
+def rand_matrix(rows, cols, scale=1.0):
+    return [rand_list(cols, scale) for _ in range(rows)]
+
+def row_str(v):
+    return '[' + ' '.join('%.6f' % x for x in v) + ']\n'
+
+
+# kernels are applied flipped (true convolution), same mode takes
+# (k - 1) // 2 rows / cols before the output position and the rest after it
+def conv_single_depth(im, k, same):
+    k_rows, k_cols = len(k), len(k[0])
+    off_x = (k_rows - 1) // 2 if same else 0
+    off_y = (k_cols - 1) // 2 if same else 0
+    out_rows = len(im) if same else len(im) - k_rows + 1
+    out_cols = len(im[0]) if same else len(im[0]) - k_cols + 1
+    y = [[0.0] * out_cols for _ in range(out_rows)]
+    for i in range(out_rows):
+        for j in range(out_cols):
+            s = 0.0
+            for k1 in range(k_rows):
+                for k2 in range(k_cols):
+                    r, c = i - off_x + k1, j - off_y + k2
+                    if 0 <= r < len(im) and 0 <= c < len(im[0]):
+                        s += k[k_rows - k1 - 1][k_cols - k2 - 1] * im[r][c]
+            y[i][j] = s
+    return y
+
+def depthwise(im, kernels, multiplier, bias, same):
+    out = []
+    for i, k in enumerate(kernels):
+        y = conv_single_depth(im[i // multiplier], k, same)
+        out.append([[v + bias[i] for v in row] for row in y])
+    return out
+
+def pointwise(im, w, bias):
+    return [[[bias[j] + sum(w[j][m] * im[m][r][c] for m in range(len(im)))
+              for c in range(len(im[0][0]))] for r in range(len(im[0]))]
+            for j in range(len(w))]
+
+def relu(im):
+    return [[[max(v, 0.0) for v in row] for row in d] for d in im]
+
+def max_pool(im, px, py):
+    return [[[max(d[r * px + a][c * py + b] for a in range(px) for b in range(py))
+              for c in range(len(d[0]) // py)] for r in range(len(d) // px)] for d in im]
+
+
+sample = [rand_matrix(ROWS, COLS) for _ in range(DEPTH)]
+
+dw_kernels = [rand_matrix(3, 3, 0.5) for _ in range(DEPTH * MULTIPLIER)]
+dw_bias = rand_list(DEPTH * MULTIPLIER, 0.1)
+pw_cnt = 4
+pw = rand_matrix(pw_cnt, DEPTH * MULTIPLIER, 0.5)
+pw_bias = rand_list(pw_cnt, 0.1)
+sep_cnt = 4
+sep_dw = [rand_matrix(2, 2, 0.5) for _ in range(pw_cnt)]
+sep_pw = rand_matrix(sep_cnt, pw_cnt, 0.5)
+sep_bias = rand_list(sep_cnt, 0.1)
+
+x = depthwise(sample, dw_kernels, MULTIPLIER, dw_bias, True)
+x = relu(x)
+x = pointwise(x, pw, pw_bias)
+x = relu(x)
+x = depthwise(x, sep_dw, 1, [0.0] * pw_cnt, False)
+x = pointwise(x, sep_pw, sep_bias)
+x = relu(x)
+x = max_pool(x, 2, 2)
+flat = [v for d in x for row in d for v in row]
+
+dense = rand_matrix(len(flat), CLASSES, 0.2)
+dense_bias = rand_list(CLASSES, 0.1)
+logits = [dense_bias[n] + sum(flat[i] * dense[i][n] for i in range(len(flat)))
+          for n in range(CLASSES)]
+exps = [2.718281828459045 ** v for v in logits]
+output = [v / sum(exps) for v in exps]
+
+with open('example/mobile.nnet', 'w') as fout:
+    fout.write('layers 10\n')
+    fout.write('layer 0 DepthwiseConv2D\n%d %d 3 3 same\n' % (DEPTH, MULTIPLIER))
+    for k in dw_kernels:
+        for row in k:
+            fout.write(row_str(row))
+    fout.write(row_str(dw_bias))
+    fout.write('layer 1 Activation\nrelu\n')
+    fout.write('layer 2 Convolution2D\n%d %d 1 1 valid\n' % (pw_cnt, DEPTH * MULTIPLIER))
+    for k in pw:
+        for v in k:
+            fout.write(row_str([v]))
+    fout.write(row_str(pw_bias))
+    fout.write('layer 3 Activation\nrelu\n')
+    fout.write('layer 4 SeparableConv2D\n%d %d 1 2 2 valid\n' % (sep_cnt, pw_cnt))
+    for k in sep_dw:
+        for row in k:
+            fout.write(row_str(row))
+    for row in sep_pw:
+        fout.write(row_str(row))
+    fout.write(row_str(sep_bias))
+    fout.write('layer 5 Activation\nrelu\n')
+    fout.write('layer 6 MaxPooling2D\n2 2\n')
+    fout.write('layer 7 Flatten\n')
+    fout.write('layer 8 Dense\n%d %d\n' % (len(flat), CLASSES))
+    for row in dense:
+        fout.write(row_str(row))
+    fout.write(row_str(dense_bias))
+    fout.write('layer 9 Activation\nsoftmax\n')
+
+with open('example/sample_mobile.dat', 'w') as fout:
+    fout.write('%d %d %d\n' % (DEPTH, ROWS, COLS))
+    for d in sample:
+        for row in d:
+            fout.write(row_str(row))
+
+with open('example/mobile_expected.dat', 'w') as fout:
+    fout.write(' '.join(repr(v) for v in output))
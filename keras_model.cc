@@ -3,117 +3,322 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cstring>
+#include <stdint.h>
 #include <math.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 using namespace std;
 
 
-std::vector<float> keras::read_1d_array(std::ifstream &fin, int cols) {
-  vector<float> arr;
-  float tmp_float;
-  char tmp_char;
-  fin >> tmp_char; // for '['
+static const double kPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+static inline bool is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+static inline bool is_delim(char c) {
+  return is_space(c) || c == '[' || c == ']' || c == ',' || c == '\0';
+}
+
+keras::TextReader::TextReader(const std::string &fname) : m_fname(fname), m_line(1) {
+  ifstream fin(fname.c_str(), ios::in | ios::binary);
+  if(!fin) throw runtime_error("Cannot open " + fname);
+  fin.seekg(0, ios::end);
+  streamoff end = fin.tellg();
+  fin.seekg(0, ios::beg);
+  // directories open fine but report -1 or a bogus size and cannot be read
+  if(end < 0 || (end > 0 && fin.peek() == EOF)) throw runtime_error("Cannot read " + fname);
+  size_t size = (size_t)end;
+  m_buf.resize(size + 1);
+  fin.read(m_buf.data(), size);
+  if((size_t)fin.gcount() != size) throw runtime_error("Cannot read " + fname);
+  m_buf[size] = '\0';
+  m_cur = m_buf.data();
+  m_end = m_cur + size;
+}
+
+void keras::TextReader::fail(const std::string &msg) const {
+  throw runtime_error(m_fname + ":" + to_string(m_line) + ": " + msg);
+}
+
+void keras::TextReader::skip_spaces() {
+  while(m_cur < m_end && is_space(*m_cur)) {
+    if(*m_cur == '\n') ++m_line;
+    ++m_cur;
+  }
+}
+
+bool keras::TextReader::eof() {
+  skip_spaces();
+  return m_cur >= m_end;
+}
+
+bool keras::TextReader::next_is(char c) {
+  skip_spaces();
+  return m_cur < m_end && *m_cur == c;
+}
+
+void keras::TextReader::expect_char(char c) {
+  skip_spaces();
+  if(m_cur >= m_end) fail(string("expected '") + c + "', got end of file");
+  if(*m_cur != c) fail(string("expected '") + c + "', got '" + *m_cur + "'");
+  ++m_cur;
+}
+
+std::string keras::TextReader::read_word() {
+  skip_spaces();
+  if(m_cur >= m_end) fail("unexpected end of file");
+  const char *p = m_cur;
+  while(p < m_end && !is_space(*p)) ++p;
+  string word(m_cur, p);
+  m_cur = p;
+  return word;
+}
+
+int keras::TextReader::read_int() {
+  skip_spaces();
+  if(m_cur >= m_end) fail("expected an integer, got end of file");
+  const char *p = m_cur;
+  bool neg = false;
+  if(*p == '-' || *p == '+') { neg = (*p == '-'); ++p; }
+  if(!is_digit(*p)) fail("expected an integer");
+  long long v = 0;
+  for(; is_digit(*p); ++p) {
+    v = v * 10 + (*p - '0');
+    if(v > 2147483647LL) fail("integer out of range");
+  }
+  if(!is_delim(*p)) fail("malformed integer");
+  m_cur = p;
+  return (int)(neg ? -v : v);
+}
+
+// Locale-free decimal parser. Up to 19 significant digits are accumulated
+// exactly, the result is scaled by an exact power of ten in double and then
+// rounded to float.
+float keras::TextReader::read_float() {
+  skip_spaces();
+  if(m_cur >= m_end) fail("expected a number, got end of file");
+  const char *p = m_cur;
+  bool neg = false;
+  if(*p == '-' || *p == '+') { neg = (*p == '-'); ++p; }
+
+  uint64_t mant = 0;
+  int digits = 0, exp10 = 0;
+  bool any = false;
+  for(; is_digit(*p); ++p) {
+    any = true;
+    if(digits < 19) {
+      mant = mant * 10 + (*p - '0');
+      if(mant) ++digits;
+    } else {
+      ++exp10;
+    }
+  }
+  if(*p == '.') {
+    ++p;
+    for(; is_digit(*p); ++p) {
+      any = true;
+      if(digits < 19) {
+        mant = mant * 10 + (*p - '0');
+        if(mant) ++digits;
+        --exp10;
+      }
+    }
+  }
+
+  double v;
+  if(!any) { // numpy writes non-finite values as nan / inf
+    if(strncmp(p, "nan", 3) == 0) v = numeric_limits<double>::quiet_NaN();
+    else if(strncmp(p, "inf", 3) == 0) v = numeric_limits<double>::infinity();
+    else fail("expected a number");
+    p += 3;
+  } else {
+    if(*p == 'e' || *p == 'E') {
+      ++p;
+      bool eneg = false;
+      if(*p == '-' || *p == '+') { eneg = (*p == '-'); ++p; }
+      if(!is_digit(*p)) fail("malformed exponent");
+      int e = 0;
+      for(; is_digit(*p); ++p) {
+        if(e < 10000) e = e * 10 + (*p - '0');
+      }
+      exp10 += eneg ? -e : e;
+    }
+    v = (double)mant;
+    if(mant != 0 && exp10 < 0) {
+      v = (exp10 >= -22) ? v / kPow10[-exp10] : v * pow(10.0, exp10);
+    } else if(mant != 0 && exp10 > 0) {
+      v = (exp10 <= 22) ? v * kPow10[exp10] : v * pow(10.0, exp10);
+    }
+  }
+  if(!is_delim(*p)) fail("malformed number");
+  m_cur = p;
+  return (float)(neg ? -v : v);
+}
+
+
+void keras::read_1d_array(keras::TextReader &fin, float *out, int cols) {
+  fin.expect_char('[');
   for(int n = 0; n < cols; ++n) {
-    fin >> tmp_float;
-    arr.push_back(tmp_float);
+    out[n] = fin.read_float();
   }
-  fin >> tmp_char; // for ']'
-  return arr;
+  fin.expect_char(']');
 }
 
 void keras::DataChunk2D::read_from_file(const std::string &fname) {
-  ifstream fin(fname.c_str());
-  fin >> m_depth >> m_rows >> m_cols;
+  keras::TextReader fin(fname);
+  m_depth = fin.read_int();
+  m_rows = fin.read_int();
+  m_cols = fin.read_int();
+  if(m_depth <= 0 || m_rows <= 0 || m_cols <= 0) fin.fail("invalid sample shape");
 
+  data.assign(m_depth, vector<vector<float> >(m_rows, vector<float>(m_cols)));
   for(int d = 0; d < m_depth; ++d) {
-    vector<vector<float> > tmp_single_depth;
     for(int r = 0; r < m_rows; ++r) {
-      vector<float> tmp_row = keras::read_1d_array(fin, m_cols);
-      tmp_single_depth.push_back(tmp_row);
+      keras::read_1d_array(fin, data[d][r].data(), m_cols);
     }
-    data.push_back(tmp_single_depth);
   }
-  fin.close();
 }
 
 
-void keras::LayerConv2D::load_weights(std::ifstream &fin) {
-  char tmp_char = ' ';
-  string tmp_str = "";
-  float tmp_float;
-  bool skip = false;
-  fin >> m_kernels_cnt >> m_depth >> m_rows >> m_cols >> m_border_mode;
-  if (m_border_mode == "[") { m_border_mode = "valid"; skip = true; }
+static std::string read_border_mode(keras::TextReader &fin) {
+  string border_mode = fin.read_word();
+  if(border_mode != "valid" && border_mode != "same") {
+    fin.fail("unknown border mode " + border_mode);
+  }
+  return border_mode;
+}
+
+static void read_kernels_2d(keras::TextReader &fin, vector<vector<vector<float> > > &kernels,
+                            int cnt, int rows, int cols) {
+  kernels.assign(cnt, vector<vector<float> >(rows, vector<float>(cols)));
+  for(int k = 0; k < cnt; ++k) {
+    for(int r = 0; r < rows; ++r) {
+      keras::read_1d_array(fin, kernels[k][r].data(), cols);
+    }
+  }
+}
+
+void keras::LayerConv2D::load_weights(keras::TextReader &fin) {
+  m_kernels_cnt = fin.read_int();
+  m_depth = fin.read_int();
+  m_rows = fin.read_int();
+  m_cols = fin.read_int();
+  if(m_kernels_cnt <= 0 || m_depth <= 0 || m_rows <= 0 || m_cols <= 0) {
+    fin.fail("invalid Convolution2D shape");
+  }
+  // old dumps have no border mode, weights start right after the shape
+  m_border_mode = fin.next_is('[') ? "valid" : read_border_mode(fin);
 
   //cout << "LayerConv2D " << m_kernels_cnt << "x" << m_depth << "x" << m_rows <<
   //            "x" << m_cols << " border_mode " << m_border_mode << endl;
   // reading kernel weights
+  m_kernels.assign(m_kernels_cnt, vector<vector<vector<float> > >(m_depth,
+                   vector<vector<float> >(m_rows, vector<float>(m_cols))));
   for(int k = 0; k < m_kernels_cnt; ++k) {
-    vector<vector<vector<float> > > tmp_depths;
     for(int d = 0; d < m_depth; ++d) {
-      vector<vector<float> > tmp_single_depth;
       for(int r = 0; r < m_rows; ++r) {
-        if (!skip) { fin >> tmp_char; } // for '['
-        else { skip = false; }
-        vector<float> tmp_row;
-        for(int c = 0; c < m_cols; ++c) {
-          fin >> tmp_float;
-          tmp_row.push_back(tmp_float);
-        }
-        fin >> tmp_char; // for ']'
-        tmp_single_depth.push_back(tmp_row);
+        keras::read_1d_array(fin, m_kernels[k][d][r].data(), m_cols);
       }
-      tmp_depths.push_back(tmp_single_depth);
     }
-    m_kernels.push_back(tmp_depths);
   }
   // reading kernel biases
-  fin >> tmp_char; // for '['
-  for(int k = 0; k < m_kernels_cnt; ++k) {
-    fin >> tmp_float;
-    m_bias.push_back(tmp_float);
+  m_bias.resize(m_kernels_cnt);
+  keras::read_1d_array(fin, m_bias.data(), m_kernels_cnt);
+
+  if(m_rows == 1 && m_cols == 1) { // computed as GEMM over depths
+    m_kernels_1x1.assign(m_kernels_cnt, vector<float>(m_depth));
+    for(int k = 0; k < m_kernels_cnt; ++k) {
+      for(int d = 0; d < m_depth; ++d) {
+        m_kernels_1x1[k][d] = m_kernels[k][d][0][0];
+      }
+    }
+  }
+}
+
+void keras::LayerDepthwiseConv2D::load_weights(keras::TextReader &fin) {
+  m_depth = fin.read_int();
+  m_multiplier = fin.read_int();
+  m_rows = fin.read_int();
+  m_cols = fin.read_int();
+  if(m_depth <= 0 || m_multiplier <= 0 || m_rows <= 0 || m_cols <= 0) {
+    fin.fail("invalid DepthwiseConv2D shape");
+  }
+  m_border_mode = read_border_mode(fin);
+
+  read_kernels_2d(fin, m_kernels, m_depth * m_multiplier, m_rows, m_cols);
+  m_bias.resize(m_depth * m_multiplier);
+  keras::read_1d_array(fin, m_bias.data(), m_depth * m_multiplier);
+}
+
+void keras::LayerSeparableConv2D::load_weights(keras::TextReader &fin) {
+  m_kernels_cnt = fin.read_int();
+  m_depth = fin.read_int();
+  m_multiplier = fin.read_int();
+  m_rows = fin.read_int();
+  m_cols = fin.read_int();
+  if(m_kernels_cnt <= 0 || m_depth <= 0 || m_multiplier <= 0 || m_rows <= 0 || m_cols <= 0) {
+    fin.fail("invalid SeparableConv2D shape");
   }
-  fin >> tmp_char; // for ']'
+  m_border_mode = read_border_mode(fin);
 
+  read_kernels_2d(fin, m_depthwise, m_depth * m_multiplier, m_rows, m_cols);
+  m_pointwise.assign(m_kernels_cnt, vector<float>(m_depth * m_multiplier));
+  for(int k = 0; k < m_kernels_cnt; ++k) {
+    keras::read_1d_array(fin, m_pointwise[k].data(), m_depth * m_multiplier);
+  }
+  m_bias.resize(m_kernels_cnt);
+  keras::read_1d_array(fin, m_bias.data(), m_kernels_cnt);
 }
 
-void keras::LayerActivation::load_weights(std::ifstream &fin) {
-  fin >> m_activation_type;
+void keras::LayerActivation::load_weights(keras::TextReader &fin) {
+  m_activation_type = fin.read_word();
   //cout << "Activation type " << m_activation_type << endl;
 }
 
-void keras::LayerMaxPooling::load_weights(std::ifstream &fin) {
-  fin >> m_pool_x >> m_pool_y;
+void keras::LayerMaxPooling::load_weights(keras::TextReader &fin) {
+  m_pool_x = fin.read_int();
+  m_pool_y = fin.read_int();
+  if(m_pool_x <= 0 || m_pool_y <= 0) fin.fail("invalid pool size");
   //cout << "MaxPooling " << m_pool_x << "x" << m_pool_y << endl;
 }
 
-void keras::LayerDense::load_weights(std::ifstream &fin) {
-  fin >> m_input_cnt >> m_neurons;
-  float tmp_float;
-  char tmp_char = ' ';
+void keras::LayerDense::load_weights(keras::TextReader &fin) {
+  m_input_cnt = fin.read_int();
+  m_neurons = fin.read_int();
+  if(m_input_cnt <= 0 || m_neurons <= 0) fin.fail("invalid Dense shape");
+
+  m_weights.assign(m_input_cnt, vector<float>(m_neurons));
   for(int i = 0; i < m_input_cnt; ++i) {
-    vector<float> tmp_n;
-    fin >> tmp_char; // for '['
-    for(int n = 0; n < m_neurons; ++n) {
-      fin >> tmp_float;
-      tmp_n.push_back(tmp_float);
-    }
-    fin >> tmp_char; // for ']'
-    m_weights.push_back(tmp_n);
+    keras::read_1d_array(fin, m_weights[i].data(), m_neurons);
   }
   //cout << "weights " << m_weights.size() << endl;
-  fin >> tmp_char; // for '['
-  for(int n = 0; n < m_neurons; ++n) {
-    fin >> tmp_float;
-    m_bias.push_back(tmp_float);
-  }
-  fin >> tmp_char; // for ']'
+  m_bias.resize(m_neurons);
+  keras::read_1d_array(fin, m_bias.data(), m_neurons);
   //cout << "bias " << m_bias.size() << endl;
-
 }
 
 keras::KerasModel::KerasModel(const string &input_fname, bool verbose)
-                                                       : m_verbose(verbose) {
-  load_weights(input_fname);
+                             : m_verbose(verbose), m_tiled(false), m_tile_rows(0) {
+  try {
+    load_weights(input_fname);
+  } catch(...) { // destructor does not run if the constructor throws
+    for(size_t i = 0; i < m_layers.size(); ++i) delete m_layers[i];
+    m_layers.clear();
+    throw;
+  }
 }
 
 
@@ -295,8 +500,133 @@ std::vector< std::vector<float> > keras::conv_single_depth_same(
 }
 
 
+// dst[j] += w * src[j] for j < n
+static inline void axpy_row(float * dst, const float * src, float w, int n) {
+  int j = 0;
+#if defined(__AVX__)
+  __m256 w8 = _mm256_set1_ps(w);
+  for(; j + 8 <= n; j += 8) {
+    __m256 d = _mm256_add_ps(_mm256_loadu_ps(dst + j), _mm256_mul_ps(w8, _mm256_loadu_ps(src + j)));
+    _mm256_storeu_ps(dst + j, d);
+  }
+#endif
+#if defined(__SSE__)
+  __m128 w4 = _mm_set1_ps(w);
+  for(; j + 4 <= n; j += 4) {
+    __m128 d = _mm_add_ps(_mm_loadu_ps(dst + j), _mm_mul_ps(w4, _mm_loadu_ps(src + j)));
+    _mm_storeu_ps(dst + j, d);
+  }
+#endif
+  for(; j < n; ++j) {
+    dst[j] += w * src[j];
+  }
+}
+
+// Accumulates convolution of one depth into y, which has to be sized for the
+// border mode and can be preset with the bias. Kernel taps are applied as
+// whole-row SIMD multiply-adds with the borders clipped up front, so the
+// inner loop has no bounds checks. Valid mode output has to be
+// im - k + 1 rows and cols.
+void keras::conv_single_depth_direct(
+	std::vector< std::vector<float> > const & im,
+	std::vector< std::vector<float> > const & k,
+	bool same,
+	std::vector< std::vector<float> > & y)
+{
+  int k1_size = k.size(), k2_size = k[0].size();
+  int off_x = same ? (k1_size - 1) >> 1 : 0;
+  int off_y = same ? (k2_size - 1) >> 1 : 0;
+  int im_rows = im.size(), im_cols = im[0].size();
+  int y_rows = y.size(), y_cols = y[0].size();
+
+  for(int i = 0; i < y_rows; ++i) {
+    float * dst = y[i].data();
+    for(int k1 = 0; k1 < k1_size; ++k1) {
+      int r = i - off_x + k1;
+      if(r < 0 || r >= im_rows) continue;
+      const float * src = im[r].data();
+      const float * k_row = k[k1_size-k1-1].data();
+      for(int k2 = 0; k2 < k2_size; ++k2) {
+        const float w = k_row[k2_size-k2-1];
+        int shift = k2 - off_y;
+        int j0 = std::max(0, -shift);
+        int j1 = std::min(y_cols, im_cols - shift);
+        if(j1 > j0) axpy_row(dst + j0, src + j0 + shift, w, j1 - j0);
+      }
+    }
+  }
+}
+
+
+// 1x1 convolution as GEMM over depths, w is kernel x depth. The loop runs
+// row by row so one row of every input depth stays in cache for all kernels.
+std::vector< std::vector< std::vector<float> > > keras::conv_pointwise(
+	std::vector< std::vector< std::vector<float> > > const & im,
+	std::vector< std::vector<float> > const & w,
+	std::vector<float> const & bias)
+{
+  size_t rows = im[0].size(), cols = im[0][0].size();
+  if(w[0].size() != im.size()) throw "input depth mismatch";
+  std::vector< std::vector< std::vector<float> > > y_ret(w.size(), vector<vector<float> >(rows));
+
+  for(size_t r = 0; r < rows; ++r) {
+    for(size_t j = 0; j < w.size(); ++j) {
+      y_ret[j][r].assign(cols, bias[j]);
+      float * dst = y_ret[j][r].data();
+      const float * w_j = w[j].data();
+      for(size_t m = 0; m < im.size(); ++m) {
+        const float * src = im[m][r].data();
+        axpy_row(dst, src, w_j[m], cols);
+      }
+    }
+  }
+  return y_ret;
+}
+
+
+static vector<vector<vector<float> > > conv_depthwise(
+	vector<vector<vector<float> > > const & im,
+	vector<vector<vector<float> > > const & kernels,
+	int multiplier, bool same, const float * bias)
+{
+  if(im.size() * multiplier != kernels.size()) throw "input depth mismatch";
+  size_t k_rows = kernels[0].size(), k_cols = kernels[0][0].size();
+  if(!same && (im[0].size() < k_rows || im[0][0].size() < k_cols)) throw "input smaller than kernel";
+  size_t size_x = same ? im[0].size() : im[0].size() - k_rows + 1;
+  size_t size_y = same ? im[0][0].size() : im[0][0].size() - k_cols + 1;
+
+  vector<vector<vector<float> > > y_ret(kernels.size());
+  for(size_t i = 0; i < kernels.size(); ++i) {
+    y_ret[i].assign(size_x, vector<float>(size_y, bias ? bias[i] : 0.0f));
+    keras::conv_single_depth_direct(im[i / multiplier], kernels[i], same, y_ret[i]);
+  }
+  return y_ret;
+}
+
+keras::DataChunk* keras::LayerDepthwiseConv2D::compute_output(keras::DataChunk* dc) {
+  keras::DataChunk2D *out = new keras::DataChunk2D();
+  out->data = conv_depthwise(dc->get_3d(), m_kernels, m_multiplier,
+                             m_border_mode == "same", m_bias.data());
+  return out;
+}
+
+keras::DataChunk* keras::LayerSeparableConv2D::compute_output(keras::DataChunk* dc) {
+  vector<vector<vector<float> > > tmp = conv_depthwise(dc->get_3d(), m_depthwise,
+                                          m_multiplier, m_border_mode == "same", 0L);
+  keras::DataChunk2D *out = new keras::DataChunk2D();
+  out->data = keras::conv_pointwise(tmp, m_pointwise, m_bias);
+  return out;
+}
+
+
 keras::DataChunk* keras::LayerConv2D::compute_output(keras::DataChunk* dc) {
 
+  if(!m_kernels_1x1.empty() && !m_reference) { // 1x1 kernels, no border handling needed
+    keras::DataChunk2D *out = new keras::DataChunk2D();
+    out->data = keras::conv_pointwise(dc->get_3d(), m_kernels_1x1, m_bias);
+    return out;
+  }
+
   unsigned int st_x = (m_kernels[0][0].size()-1) >> 1;
   unsigned int st_y = (m_kernels[0][0][0].size()-1) >> 1;
   vector< vector< vector<float> > > y_ret;
@@ -375,16 +705,266 @@ keras::DataChunk* keras::LayerDense::compute_output(keras::DataChunk* dc) {
 }
 
 
+static const char kDumpMagic[8] = { 'K', '2', 'C', 'P', 'P', 'D', 'M', 'P' };
+
+void keras::write_layer_output(std::ofstream &fout, int layer, const std::string &name, keras::DataChunk *dc) {
+  vector<uint32_t> shape;
+  if(dc->get_data_dim() == 3) {
+    auto const & d = dc->get_3d();
+    shape.push_back(d.size());
+    shape.push_back(d[0].size());
+    shape.push_back(d[0][0].size());
+  } else if(dc->get_data_dim() == 1) {
+    shape.push_back(dc->get_1d().size());
+  } else { throw "data dim not supported"; }
+
+  int32_t idx = layer;
+  uint32_t name_len = name.size();
+  uint32_t dims = shape.size();
+  fout.write((const char*)&idx, sizeof(idx));
+  fout.write((const char*)&name_len, sizeof(name_len));
+  fout.write(name.data(), name_len);
+  fout.write((const char*)&dims, sizeof(dims));
+  fout.write((const char*)shape.data(), dims * sizeof(uint32_t));
+
+  if(dims == 3) {
+    auto const & d = dc->get_3d();
+    for(size_t i = 0; i < d.size(); ++i) {
+      for(size_t j = 0; j < d[i].size(); ++j) {
+        fout.write((const char*)d[i][j].data(), d[i][j].size() * sizeof(float));
+      }
+    }
+  } else {
+    auto const & f = dc->get_1d();
+    fout.write((const char*)f.data(), f.size() * sizeof(float));
+  }
+}
+
+std::vector<keras::LayerOutput> keras::read_layer_outputs(const std::string &fname) {
+  ifstream fin(fname.c_str(), ios::in | ios::binary);
+  if(!fin) throw runtime_error("Cannot open " + fname);
+  char magic[sizeof(kDumpMagic)];
+  if(!fin.read(magic, sizeof(magic)) || memcmp(magic, kDumpMagic, sizeof(magic)) != 0) {
+    throw runtime_error(fname + ": not a layer dump file");
+  }
+
+  vector<keras::LayerOutput> outputs;
+  int32_t idx;
+  while(fin.read((char*)&idx, sizeof(idx))) {
+    keras::LayerOutput o;
+    o.m_layer = idx;
+    uint32_t name_len = 0, dims = 0;
+    fin.read((char*)&name_len, sizeof(name_len));
+    if(!fin || name_len > 1024) throw runtime_error(fname + ": corrupted record");
+    o.m_name.resize(name_len);
+    fin.read(&o.m_name[0], name_len);
+    fin.read((char*)&dims, sizeof(dims));
+    if(!fin || dims == 0 || dims > 3) throw runtime_error(fname + ": corrupted record");
+    o.m_shape.resize(dims);
+    fin.read((char*)o.m_shape.data(), dims * sizeof(uint32_t));
+    size_t size = 1;
+    for(size_t i = 0; i < dims; ++i) size *= o.m_shape[i];
+    o.m_values.resize(size);
+    fin.read((char*)o.m_values.data(), size * sizeof(float));
+    if(!fin) throw runtime_error(fname + ": truncated record of layer " + to_string(idx));
+    outputs.push_back(o);
+  }
+  return outputs;
+}
+
+
+// rows of a convolution, in same mode kernels reach (k_rows - 1) / 2 rows
+// above and the rest below like in conv_single_depth_*
+static int conv_output_rows(bool same, int k_rows, int in_rows) {
+  return same ? in_rows : in_rows - k_rows + 1;
+}
+
+static void conv_tile_rows(bool same, int k_rows, int first, int last, int in_rows,
+                           int &in_first, int &in_last, int &out_first) {
+  int st = (k_rows - 1) >> 1;
+  if(same) { // halo rows at the band borders come out wrong and are cut off
+    in_first = std::max(0, first - st);
+    in_last = std::min(in_rows, last + (k_rows - 1 - st));
+    out_first = in_first;
+  } else {
+    in_first = first;
+    in_last = last + k_rows - 1;
+    out_first = first;
+  }
+}
+
+int keras::LayerConv2D::get_output_rows(int in_rows) const {
+  // valid mode of conv_single_depth_valid is not defined for even kernels
+  if(m_border_mode == "valid" && m_rows % 2 == 0) return -1;
+  return conv_output_rows(m_border_mode == "same", m_rows, in_rows);
+}
+
+void keras::LayerConv2D::get_tile_rows(int first, int last, int in_rows,
+                                       int &in_first, int &in_last, int &out_first) const {
+  conv_tile_rows(m_border_mode == "same", m_rows, first, last, in_rows, in_first, in_last, out_first);
+}
+
+int keras::LayerDepthwiseConv2D::get_output_rows(int in_rows) const {
+  return conv_output_rows(m_border_mode == "same", m_rows, in_rows);
+}
+
+void keras::LayerDepthwiseConv2D::get_tile_rows(int first, int last, int in_rows,
+                                                int &in_first, int &in_last, int &out_first) const {
+  conv_tile_rows(m_border_mode == "same", m_rows, first, last, in_rows, in_first, in_last, out_first);
+}
+
+int keras::LayerSeparableConv2D::get_output_rows(int in_rows) const {
+  return conv_output_rows(m_border_mode == "same", m_rows, in_rows);
+}
+
+void keras::LayerSeparableConv2D::get_tile_rows(int first, int last, int in_rows,
+                                                int &in_first, int &in_last, int &out_first) const {
+  conv_tile_rows(m_border_mode == "same", m_rows, first, last, in_rows, in_first, in_last, out_first);
+}
+
+int keras::LayerActivation::get_output_rows(int in_rows) const {
+  return (m_activation_type == "relu") ? in_rows : -1; // only relu works on 3D data
+}
+
+void keras::LayerActivation::get_tile_rows(int first, int last, int /*in_rows*/,
+                                           int &in_first, int &in_last, int &out_first) const {
+  in_first = first;
+  in_last = last;
+  out_first = first;
+}
+
+int keras::LayerMaxPooling::get_output_rows(int in_rows) const {
+  return in_rows / m_pool_x;
+}
+
+void keras::LayerMaxPooling::get_tile_rows(int first, int last, int /*in_rows*/,
+                                           int &in_first, int &in_last, int &out_first) const {
+  in_first = first * m_pool_x;
+  in_last = last * m_pool_x;
+  out_first = first;
+}
+
+static size_t detect_l2_cache_size() {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if(size > 0) return size;
+#endif
+  return 256 * 1024; // common lower bound if it cannot be detected
+}
+
+// keep only rows [first, last) of every depth
+static void cut_rows(vector<vector<vector<float> > > &data, int first, int last) {
+  for(size_t d = 0; d < data.size(); ++d) {
+    data[d].erase(data[d].begin() + last, data[d].end());
+    data[d].erase(data[d].begin(), data[d].begin() + first);
+  }
+}
+
+// Computes layers [first, last) on bands of output rows. For every band the
+// needed input rows (including halo for convolutions) are found going
+// backwards through the chain, then the band goes through all layers while
+// it is still in cache. Results are the same as without tiling, halo rows
+// are computed more than once.
+keras::DataChunk* keras::KerasModel::compute_tiled(keras::DataChunk *dc, int first, int last) {
+  auto const & im = dc->get_3d();
+  int n = last - first;
+  vector<int> rows(n + 1);
+  rows[0] = im[0].size();
+  for(int i = 0; i < n; ++i) rows[i+1] = m_layers[first+i]->get_output_rows(rows[i]);
+
+  vector<int> in_first(n + 1), in_last(n + 1), out_first(n);
+  int tile = m_tile_rows;
+  if(tile <= 0) {
+    // estimated bytes of all layer outputs needed per row of the last output,
+    // columns are assumed to shrink like rows do
+    double row_bytes = im.size() * im[0][0].size() * sizeof(float) * (double)rows[0] / rows[n];
+    size_t depth = im.size();
+    for(int i = 0; i < n; ++i) {
+      if(m_layers[first+i]->get_output_units() > 0) depth = m_layers[first+i]->get_output_units();
+      double cols = (double)im[0][0].size() * rows[i+1] / rows[0];
+      row_bytes += depth * cols * sizeof(float) * rows[i+1] / rows[n];
+    }
+    tile = (int)(detect_l2_cache_size() / 2 / row_bytes);
+
+    // halo rows per band relative to the band itself, bands have to be wide
+    // enough to keep the recomputed halo below 1/8 of the work
+    in_first[n] = rows[n] / 2;
+    in_last[n] = in_first[n] + 1;
+    double halo = 0;
+    for(int i = n - 1; i >= 0; --i) {
+      m_layers[first+i]->get_tile_rows(in_first[i+1], in_last[i+1], rows[i],
+                                       in_first[i], in_last[i], out_first[i]);
+      double scale = (double)rows[i] / rows[n];
+      halo = std::max(halo, (in_last[i] - in_first[i] - scale) / scale);
+    }
+    tile = std::max(tile, (int)ceil(8 * halo));
+    tile = std::max(1, std::min(tile, rows[n]));
+  }
+  if(m_verbose) cout << "Tiled layers " << first << "-" << last - 1 << " by " << tile << " rows" << endl;
+
+  keras::DataChunk2D *out = new keras::DataChunk2D();
+  for(int t = 0; t < rows[n]; t += tile) {
+    in_first[n] = t;
+    in_last[n] = std::min(t + tile, rows[n]);
+    for(int i = n - 1; i >= 0; --i) {
+      m_layers[first+i]->get_tile_rows(in_first[i+1], in_last[i+1], rows[i],
+                                       in_first[i], in_last[i], out_first[i]);
+    }
+
+    keras::DataChunk2D *band = new keras::DataChunk2D();
+    band->data.resize(im.size());
+    for(size_t d = 0; d < im.size(); ++d) {
+      band->data[d].assign(im[d].begin() + in_first[0], im[d].begin() + in_last[0]);
+    }
+    for(int i = 0; i < n; ++i) {
+      keras::DataChunk2D *tmp = static_cast<keras::DataChunk2D*>(m_layers[first+i]->compute_output(band));
+      delete band;
+      cut_rows(tmp->data, in_first[i+1] - out_first[i], in_last[i+1] - out_first[i]);
+      band = tmp;
+    }
+
+    if(out->data.empty()) out->data.resize(band->data.size());
+    for(size_t d = 0; d < band->data.size(); ++d) {
+      out->data[d].reserve(rows[n]);
+      for(size_t r = 0; r < band->data[d].size(); ++r) {
+        out->data[d].push_back(std::move(band->data[d][r]));
+      }
+    }
+    delete band;
+  }
+  return out;
+}
+
+
 std::vector<float> keras::KerasModel::compute_output(keras::DataChunk *dc) {
   //cout << endl << "KerasModel compute output" << endl;
   //cout << "Input data size:" << endl;
   dc->show_name();
 
+  ofstream fdump;
+  if(!m_dump_fname.empty()) {
+    fdump.open(m_dump_fname.c_str(), ios::out | ios::binary);
+    if(!fdump) throw runtime_error("Cannot open " + m_dump_fname);
+    fdump.write(kDumpMagic, sizeof(kDumpMagic));
+  }
+
   keras::DataChunk *inp = dc;
   keras::DataChunk *out = 0;
   for(int l = 0; l < (int)m_layers.size(); ++l) {
     //cout << "Processing layer " << m_layers[l]->get_name() << endl;
-    out = m_layers[l]->compute_output(inp);
+    int chain_end = l;
+    if(m_tiled && inp->get_data_dim() == 3) {
+      int rows = inp->get_3d()[0].size();
+      while(chain_end < (int)m_layers.size() &&
+            (rows = m_layers[chain_end]->get_output_rows(rows)) > 0) ++chain_end;
+    }
+    if(chain_end - l >= 2) { // dumped as output of the last layer in chain
+      out = compute_tiled(inp, l, chain_end);
+      l = chain_end - 1;
+    } else {
+      out = m_layers[l]->compute_output(inp);
+    }
+    if(fdump.is_open()) keras::write_layer_output(fdump, l, m_layers[l]->get_name(), out);
 
     //cout << "Input" << endl;
     //inp->show_name();
@@ -405,21 +985,27 @@ std::vector<float> keras::KerasModel::compute_output(keras::DataChunk *dc) {
 
 void keras::KerasModel::load_weights(const string &input_fname) {
   if(m_verbose) cout << "Reading model from " << input_fname << endl;
-  ifstream fin(input_fname.c_str());
+  keras::TextReader fin(input_fname);
   string layer_type = "";
-  string tmp_str = "";
   int tmp_int = 0;
 
-  fin >> tmp_str >> m_layers_cnt;
+  if(fin.read_word() != "layers") fin.fail("expected 'layers'");
+  m_layers_cnt = fin.read_int();
   if(m_verbose) cout << "Layers " << m_layers_cnt << endl;
 
   for(int layer = 0; layer < m_layers_cnt; ++layer) { // iterate over layers
-    fin >> tmp_str >> tmp_int >> layer_type;
+    if(fin.read_word() != "layer") fin.fail("expected 'layer'");
+    tmp_int = fin.read_int();
+    layer_type = fin.read_word();
     if(m_verbose) cout << "Layer " << tmp_int << " " << layer_type << endl;
 
     Layer *l = 0L;
     if(layer_type == "Convolution2D") {
       l = new LayerConv2D();
+    } else if(layer_type == "DepthwiseConv2D") {
+      l = new LayerDepthwiseConv2D();
+    } else if(layer_type == "SeparableConvolution2D" || layer_type == "SeparableConv2D") {
+      l = new LayerSeparableConv2D();
     } else if(layer_type == "Activation") {
       l = new LayerActivation();
     } else if(layer_type == "MaxPooling2D") {
@@ -432,14 +1018,18 @@ void keras::KerasModel::load_weights(const string &input_fname) {
       continue; // we dont need dropout layer in prediciton mode
     }
     if(l == 0L) {
-      cout << "Layer is empty, maybe it is not defined? Cannot define network." << endl;
-      return;
+      fin.fail("unknown layer type " + layer_type + ", cannot define network");
     }
-    l->load_weights(fin);
     m_layers.push_back(l);
+    l->load_weights(fin);
   }
+}
 
-  fin.close();
+void keras::KerasModel::set_reference_kernels(bool enable) {
+  for(size_t i = 0; i < m_layers.size(); ++i) {
+    keras::LayerConv2D *conv = dynamic_cast<keras::LayerConv2D*>(m_layers[i]);
+    if(conv) conv->m_reference = enable;
+  }
 }
 
 keras::KerasModel::~KerasModel() {
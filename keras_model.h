@@ -8,10 +8,14 @@
 
 namespace keras
 {
-	std::vector<float> read_1d_array(std::ifstream &fin, int cols);
+	class TextReader;
+
+	void read_1d_array(keras::TextReader &fin, float *out, int cols);
 	void missing_activation_impl(const std::string &act);
 	std::vector< std::vector<float> > conv_single_depth_valid(std::vector< std::vector<float> > const & im, std::vector< std::vector<float> > const & k);
 	std::vector< std::vector<float> > conv_single_depth_same(std::vector< std::vector<float> > const & im, std::vector< std::vector<float> > const & k);
+	void conv_single_depth_direct(std::vector< std::vector<float> > const & im, std::vector< std::vector<float> > const & k, bool same, std::vector< std::vector<float> > & y);
+	std::vector< std::vector< std::vector<float> > > conv_pointwise(std::vector< std::vector< std::vector<float> > > const & im, std::vector< std::vector<float> > const & w, std::vector<float> const & bias);
 
 	class DataChunk;
 	class DataChunk2D;
@@ -22,11 +26,43 @@ namespace keras
 	class LayerMaxPooling;
 	class LayerActivation;
 	class LayerConv2D;
+	class LayerDepthwiseConv2D;
+	class LayerSeparableConv2D;
 	class LayerDense;
 
 	class KerasModel;
+	class LayerOutput;
+
+	void write_layer_output(std::ofstream &fout, int layer, const std::string &name, keras::DataChunk *dc);
+	std::vector<keras::LayerOutput> read_layer_outputs(const std::string &fname);
 }
 
+// Reads a whole text file (.nnet dump or data sample) into memory and parses
+// it token by token. Numbers are parsed without iostreams and locales,
+// malformed input is reported as std::runtime_error with file name and line.
+class keras::TextReader {
+public:
+  TextReader(const std::string &fname);
+
+  std::string read_word();
+  int read_int();
+  float read_float();
+  void expect_char(char c);
+  bool next_is(char c); // peek at the next non-space character
+  bool eof();
+  [[noreturn]] void fail(const std::string &msg) const;
+
+  std::string m_fname;
+  int m_line;
+
+private:
+  void skip_spaces();
+
+  std::vector<char> m_buf; // file content with a trailing '\0'
+  const char *m_cur;
+  const char *m_end;
+};
+
 class keras::DataChunk {
 public:
   virtual ~DataChunk() {}
@@ -101,7 +137,7 @@ public:
 
 class keras::Layer {
 public:
-  virtual void load_weights(std::ifstream &fin) = 0;
+  virtual void load_weights(keras::TextReader &fin) = 0;
   virtual keras::DataChunk* compute_output(keras::DataChunk*) = 0;
 
   Layer(std::string name) : m_name(name) {}
@@ -111,6 +147,15 @@ public:
   virtual unsigned int get_input_cols() const = 0;
   virtual unsigned int get_output_units() const = 0;
 
+  // Row-tiled execution (KerasModel::set_tiled_execution) for layers whose
+  // output rows depend only on a band of input rows. get_output_rows returns
+  // -1 if the layer cannot be tiled. get_tile_rows gives input rows
+  // [in_first, in_last) needed for output rows [first, last) and the output
+  // row which compute_output produces first from that band.
+  virtual int get_output_rows(int /*in_rows*/) const { return -1; }
+  virtual void get_tile_rows(int /*first*/, int /*last*/, int /*in_rows*/,
+                             int &/*in_first*/, int &/*in_last*/, int &/*out_first*/) const {}
+
   std::string get_name() { return m_name; }
   std::string m_name;
 };
@@ -119,7 +164,7 @@ public:
 class keras::LayerFlatten : public Layer {
 public:
   LayerFlatten() : Layer("Flatten") {}
-  void load_weights(std::ifstream &fin) {};
+  void load_weights(keras::TextReader &fin) {};
   keras::DataChunk* compute_output(keras::DataChunk*);
 
   virtual unsigned int get_input_rows() const { return 0; } // look for the value in the preceding layer
@@ -132,8 +177,10 @@ class keras::LayerMaxPooling : public Layer {
 public:
   LayerMaxPooling() : Layer("MaxPooling2D") {};
 
-  void load_weights(std::ifstream &fin);
+  void load_weights(keras::TextReader &fin);
   keras::DataChunk* compute_output(keras::DataChunk*);
+  int get_output_rows(int in_rows) const;
+  void get_tile_rows(int first, int last, int in_rows, int &in_first, int &in_last, int &out_first) const;
 
   virtual unsigned int get_input_rows() const { return 0; } // look for the value in the preceding layer
   virtual unsigned int get_input_cols() const { return 0; } // same as for rows
@@ -147,8 +194,10 @@ public:
 class keras::LayerActivation : public Layer {
 public:
   LayerActivation() : Layer("Activation") {}
-  void load_weights(std::ifstream &fin);
+  void load_weights(keras::TextReader &fin);
   keras::DataChunk* compute_output(keras::DataChunk*);
+  int get_output_rows(int in_rows) const;
+  void get_tile_rows(int first, int last, int in_rows, int &in_first, int &in_last, int &out_first) const;
 
   virtual unsigned int get_input_rows() const { return 0; } // look for the value in the preceding layer
   virtual unsigned int get_input_cols() const { return 0; } // same as for rows
@@ -159,11 +208,63 @@ public:
 
 class keras::LayerConv2D : public Layer {
 public:
-  LayerConv2D() : Layer("Conv2D") {}
+  LayerConv2D() : Layer("Conv2D"), m_reference(false) {}
 
-  void load_weights(std::ifstream &fin);
+  void load_weights(keras::TextReader &fin);
   keras::DataChunk* compute_output(keras::DataChunk*);
+  int get_output_rows(int in_rows) const;
+  void get_tile_rows(int first, int last, int in_rows, int &in_first, int &in_last, int &out_first) const;
   std::vector<std::vector<std::vector<std::vector<float> > > > m_kernels; // kernel, depth, rows, cols
+  std::vector<std::vector<float> > m_kernels_1x1; // kernel, depth; only for 1x1 kernels
+  std::vector<float> m_bias; // kernel
+
+  virtual unsigned int get_input_rows() const { return m_rows; }
+  virtual unsigned int get_input_cols() const { return m_cols; }
+  virtual unsigned int get_output_units() const { return m_kernels_cnt; }
+
+  std::string m_border_mode;
+  int m_kernels_cnt;
+  int m_depth;
+  int m_rows;
+  int m_cols;
+  bool m_reference; // use conv_single_depth_* also for 1x1 kernels
+};
+
+// Convolves every input depth with its own m_multiplier kernels,
+// output depth d * m_multiplier + m comes from input depth d.
+class keras::LayerDepthwiseConv2D : public Layer {
+public:
+  LayerDepthwiseConv2D() : Layer("DepthwiseConv2D") {}
+
+  void load_weights(keras::TextReader &fin);
+  keras::DataChunk* compute_output(keras::DataChunk*);
+  int get_output_rows(int in_rows) const;
+  void get_tile_rows(int first, int last, int in_rows, int &in_first, int &in_last, int &out_first) const;
+  std::vector<std::vector<std::vector<float> > > m_kernels; // depth * multiplier, rows, cols
+  std::vector<float> m_bias; // depth * multiplier
+
+  virtual unsigned int get_input_rows() const { return m_rows; }
+  virtual unsigned int get_input_cols() const { return m_cols; }
+  virtual unsigned int get_output_units() const { return m_depth * m_multiplier; }
+
+  std::string m_border_mode;
+  int m_depth;
+  int m_multiplier;
+  int m_rows;
+  int m_cols;
+};
+
+// Depthwise convolution without bias followed by a 1x1 convolution.
+class keras::LayerSeparableConv2D : public Layer {
+public:
+  LayerSeparableConv2D() : Layer("SeparableConv2D") {}
+
+  void load_weights(keras::TextReader &fin);
+  keras::DataChunk* compute_output(keras::DataChunk*);
+  int get_output_rows(int in_rows) const;
+  void get_tile_rows(int first, int last, int in_rows, int &in_first, int &in_last, int &out_first) const;
+  std::vector<std::vector<std::vector<float> > > m_depthwise; // depth * multiplier, rows, cols
+  std::vector<std::vector<float> > m_pointwise; // kernel, depth * multiplier
   std::vector<float> m_bias; // kernel
 
   virtual unsigned int get_input_rows() const { return m_rows; }
@@ -173,6 +274,7 @@ public:
   std::string m_border_mode;
   int m_kernels_cnt;
   int m_depth;
+  int m_multiplier;
   int m_rows;
   int m_cols;
 };
@@ -181,7 +283,7 @@ class keras::LayerDense : public Layer {
 public:
   LayerDense() : Layer("Dense") {}
 
-  void load_weights(std::ifstream &fin);
+  void load_weights(keras::TextReader &fin);
   keras::DataChunk* compute_output(keras::DataChunk*);
   std::vector<std::vector<float> > m_weights; //input, neuron
   std::vector<float> m_bias; // neuron
@@ -194,6 +296,18 @@ public:
   int m_neurons;
 };
 
+// One record of a layer dump written by KerasModel::set_layer_dump().
+// The file starts with the "K2CPPDMP" magic followed by records of
+// layer index, name length, name, number of dims, dims and float values,
+// all in native byte order.
+class keras::LayerOutput {
+public:
+  int m_layer;
+  std::string m_name;
+  std::vector<unsigned int> m_shape; // depth, rows, cols or just size
+  std::vector<float> m_values;
+};
+
 class keras::KerasModel {
 public:
   KerasModel(const std::string &input_fname, bool verbose);
@@ -204,12 +318,32 @@ public:
   unsigned int get_input_cols() const { return m_layers.front()->get_input_cols(); }
   int get_output_length() const;
 
+  // write every layer output into a binary file on each compute_output call,
+  // empty file name disables dumping
+  void set_layer_dump(const std::string &fname) { m_dump_fname = fname; }
+
+  // compute chains of convolution, activation and max pooling layers band by
+  // band of rows so that intermediate outputs stay in cache; tile_rows = 0
+  // picks the band height from layer shapes and the L2 cache size.
+  // With layer dumping on, a tiled chain is dumped as one record under the
+  // index of its last layer.
+  void set_tiled_execution(bool enable, int tile_rows = 0) { m_tiled = enable; m_tile_rows = tile_rows; }
+
+  // compute 1x1 convolutions with the generic conv_single_depth_* kernels
+  // instead of conv_pointwise, to get reference dumps for compare_layers
+  void set_reference_kernels(bool enable);
+
 private:
 
+  keras::DataChunk* compute_tiled(keras::DataChunk *dc, int first, int last);
+
   void load_weights(const std::string &input_fname);
   int m_layers_cnt; // number of layers
   std::vector<Layer *> m_layers; // container with layers
   bool m_verbose;
+  std::string m_dump_fname;
+  bool m_tiled;
+  int m_tile_rows;
 
 };
 
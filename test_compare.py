@@ -17,6 +17,7 @@ parser = argparse.ArgumentParser(description='This is a simple script compare pr
 
 parser.add_argument('-k', '--keras_response', help="Response from Keras (test_run_cnn.py)", required=True)
 parser.add_argument('-c', '--keras2cpp_response', help="Response from Keras2cpp (test_run_cnn.cc)", required=True)
+parser.add_argument('-t', '--tolerance', help="Allowed sum of absolute differences", type=float, default=1e-6)
 args = parser.parse_args()
 
 
@@ -29,7 +30,7 @@ if len(keras_output) != len(keras2cpp_output):
 
 sub = np.sum(np.abs(keras_output - keras2cpp_output))
 
-if sub < 1e-6:
+if sub < args.tolerance:
     print 'Test: [DONE]'
     print 'Dump is working correctly.'
     sys.exit(0)
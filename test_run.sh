@@ -11,6 +11,10 @@ DATA_SAMPLE="test_random_input.dat"
 KERAS_OUTPUT="test_keras_output.dat"
 KERAS2CPP_OUTPUT="test_keras2cpp_output.dat"
 TEST_BIN="test_bin"
+COMPARE_BIN="compare_layers_bin"
+MOBILE_OUTPUT="test_mobile_output.dat"
+MOBILE_DUMP="test_mobile_layers.dump"
+MOBILE_REFERENCE_DUMP="test_mobile_reference_layers.dump"
 
 echo 'Test, step 1'
 echo 'Dump network into plain text file' $DUMPED_CNN
@@ -25,12 +29,23 @@ echo 'Test, step 3'
 echo 'Compile keras2cpp code'
 g++ -std=c++11 test_run_cnn.cc keras_model.cc -o $TEST_BIN
 echo 'Run predictions with dumped network and random data sample from step 2'
-./$TEST_BIN $DUMPED_CNN $DATA_SAMPLE $KERAS2CPP_OUTPUT
+./$TEST_BIN $DUMPED_CNN $DATA_SAMPLE $KERAS2CPP_OUTPUT --check-tiled || exit 1
 
 echo 'Test, step 4'
 echo 'Compare Keras and Keras2cpp outputs'
 python test_compare.py --keras_response $KERAS_OUTPUT --keras2cpp_response $KERAS2CPP_OUTPUT
 
+echo 'Test, step 5'
+echo 'Run example/mobile.nnet with DepthwiseConv2D, 1x1 Convolution2D and SeparableConv2D layers'
+echo 'and compare with the naive reference from example/make_mobile_example.py'
+./$TEST_BIN example/mobile.nnet example/sample_mobile.dat $MOBILE_OUTPUT $MOBILE_DUMP --check-tiled || exit 1
+python test_compare.py --keras_response example/mobile_expected.dat --keras2cpp_response $MOBILE_OUTPUT --tolerance 1e-5
+echo 'Compare layer outputs of the 1x1 convolution fast path with the generic kernels'
+echo '(they sum in a different order, so a few hundred ulp close to zero are expected)'
+g++ -std=c++11 compare_layers.cc keras_model.cc -o $COMPARE_BIN
+./$TEST_BIN example/mobile.nnet example/sample_mobile.dat $MOBILE_OUTPUT $MOBILE_REFERENCE_DUMP --reference-kernels
+./$COMPARE_BIN $MOBILE_REFERENCE_DUMP $MOBILE_DUMP 1024
+
 # Clean
 echo 'Cleaning after test'
 rm $DUMPED_CNN
@@ -38,5 +53,9 @@ rm $DATA_SAMPLE
 rm $KERAS_OUTPUT
 rm $KERAS2CPP_OUTPUT
 rm $TEST_BIN
+rm $COMPARE_BIN
+rm $MOBILE_OUTPUT
+rm $MOBILE_DUMP
+rm $MOBILE_REFERENCE_DUMP
 # used only if you log hidden layers output in test_run_cnn.py file
 #rm test_layer_*.output
@@ -1,6 +1,7 @@
 #include "keras_model.h"
 
 #include <iostream>
+#include <cstring>
 
 using namespace std;
 using namespace keras;
@@ -9,14 +10,24 @@ using namespace keras;
 
 int main(int argc, char *argv[]) {
 
-  if(argc != 4) {
+  // --check-tiled compares tiled execution with the plain one bit by bit,
+  // --reference-kernels disables the 1x1 convolution fast path
+  bool check_tiled = false;
+  bool reference = false;
+  vector<string> args;
+  for(int i = 1; i < argc; ++i) {
+    if(string(argv[i]) == "--check-tiled") check_tiled = true;
+    else if(string(argv[i]) == "--reference-kernels") reference = true;
+    else args.push_back(argv[i]);
+  }
+  if(args.size() != 3 && args.size() != 4) {
     cout << "Wrong input, going to exit." << endl;
-    cout << "There should be arguments: dumped_cnn_file input_sample output_file." << endl;
+    cout << "There should be arguments: dumped_cnn_file input_sample output_file [layers_dump_file] [--check-tiled] [--reference-kernels]." << endl;
     return -1;
   }
-  string dumped_cnn = argv[1];
-  string input_data = argv[2];
-  string response_file = argv[3];
+  string dumped_cnn = args[0];
+  string input_data = args[1];
+  string response_file = args[2];
 
   cout << "Testing network from " << dumped_cnn << " on data from " << input_data << endl;
 
@@ -26,8 +37,26 @@ int main(int argc, char *argv[]) {
 
   // Construct network
   KerasModel m(dumped_cnn, false);
+  m.set_reference_kernels(reference);
+  if(args.size() == 4) m.set_layer_dump(args[3]); // for compare_layers
   std::vector<float> response = m.compute_output(sample);
 
+  if(check_tiled) {
+    m.set_layer_dump("");
+    int tiles[] = { 0, 1, 2, 3, 5, 8, 13 }; // 0 = chosen by the model
+    for(unsigned int i = 0; i < sizeof(tiles) / sizeof(tiles[0]); ++i) {
+      m.set_tiled_execution(true, tiles[i]);
+      std::vector<float> tiled = m.compute_output(sample);
+      if(tiled.size() != response.size() ||
+         memcmp(tiled.data(), response.data(), response.size() * sizeof(float)) != 0) {
+        cout << "Tiled execution with " << tiles[i] << " rows differs from plain one." << endl;
+        delete sample;
+        return 1;
+      }
+    }
+    cout << "Tiled execution matches plain one." << endl;
+  }
+
   // clean sample
   delete sample;
 